@@ -0,0 +1,158 @@
+#ifndef SHAREDINPUTRING_H
+#define SHAREDINPUTRING_H
+
+// Ring of normalized input samples in shared memory, used by TouchInputBroker and SharedInputFilter.  This
+//  has no Qt dependency so it can be tested without a display (see tests/sharedinputring_test.cpp)
+// Single producer: each slot has a sequence number (seqlock) which is 2*n + 1 while sample n is being written
+//  and 2*n + 2 once complete, so readers never lock and never make system calls.  A reader that falls more
+//  than a full ring behind, or sees the producer restart, is told samples were skipped so it can cancel any
+//  input sequence in progress
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#define SHARED_INPUT_MAGIC 0x54434849  // "TCHI"
+#define SHARED_INPUT_VERSION 2
+#define SHARED_RING_SIZE 256  // must be power of 2
+#define MAX_SHARED_POINTS 10
+
+struct SharedInputPoint
+{
+  int32_t id;
+  int32_t state;
+  double x, y;
+  double width, height;  // contact size, 0 if unknown
+  double pressure;
+};
+
+struct SharedInputSample
+{
+  int32_t type;  // QEvent::TouchUpdate for touch samples, otherwise tablet event type
+  int32_t state;  // Qt::TouchPointStates for touch, QTabletEvent::PointerType for tablet
+  int32_t buttons;
+  int32_t deviceid;
+  int32_t npoints;
+  int32_t reserved;
+  int64_t owner;  // pid of process which should dispatch this sample, 0 if unknown
+  SharedInputPoint points[MAX_SHARED_POINTS];
+};
+
+struct SharedInputSlot
+{
+  std::atomic<uint64_t> seq;
+  SharedInputSample sample;
+};
+
+struct SharedInputRing
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;
+  std::atomic<uint32_t> epoch;  // incremented each time a producer takes over the ring
+  std::atomic<uint64_t> epochStart;  // writeSeq when current producer took over
+  std::atomic<uint64_t> writeSeq;  // number of samples published
+  SharedInputSlot slots[SHARED_RING_SIZE];
+};
+
+inline bool sharedRingValid(const SharedInputRing* ring)
+{
+  return ring->magic == SHARED_INPUT_MAGIC && ring->version == SHARED_INPUT_VERSION
+      && ring->size == SHARED_RING_SIZE;
+}
+
+// called by producer on newly created or taken over ring; returns sequence number of next sample to write.
+//  For a valid ring, we continue from previous producer's sequence so attached readers don't see a jump back
+inline uint64_t sharedRingInit(SharedInputRing* ring)
+{
+  if(!sharedRingValid(ring)) {
+    memset(static_cast<void*>(ring), 0, sizeof(SharedInputRing));
+    for(int ii = 0; ii < SHARED_RING_SIZE; ++ii)
+      ring->slots[ii].seq.store(0, std::memory_order_relaxed);
+    ring->epoch.store(0, std::memory_order_relaxed);
+    ring->epochStart.store(0, std::memory_order_relaxed);
+    ring->writeSeq.store(0, std::memory_order_relaxed);
+    ring->version = SHARED_INPUT_VERSION;
+    ring->size = SHARED_RING_SIZE;
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->magic = SHARED_INPUT_MAGIC;
+  }
+  uint64_t seq = ring->writeSeq.load(std::memory_order_acquire);
+  ring->epochStart.store(seq, std::memory_order_relaxed);
+  ring->epoch.fetch_add(1, std::memory_order_release);
+  return seq;
+}
+
+inline SharedInputSample* sharedRingBeginWrite(SharedInputRing* ring, uint64_t seq)
+{
+  SharedInputSlot& slot = ring->slots[seq & (SHARED_RING_SIZE - 1)];
+  slot.seq.store(2*seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return &slot.sample;
+}
+
+inline void sharedRingEndWrite(SharedInputRing* ring, uint64_t seq)
+{
+  ring->slots[seq & (SHARED_RING_SIZE - 1)].seq.store(2*seq + 2, std::memory_order_release);
+  ring->writeSeq.store(seq + 1, std::memory_order_release);
+}
+
+class SharedInputReader
+{
+public:
+  enum Result { Empty, Sample, Skipped };
+
+  SharedInputReader() : ring(NULL), readSeq(0), epoch(0) {}
+  // only samples published after attach are read
+  void attach(const SharedInputRing* r)
+  {
+    ring = r;
+    epoch = ring->epoch.load(std::memory_order_acquire);
+    readSeq = ring->writeSeq.load(std::memory_order_acquire);
+  }
+  bool hasData() const { return ring && ring->writeSeq.load(std::memory_order_acquire) != readSeq; }
+
+  // Sample: next sample copied to out; Skipped: one or more samples were lost; Empty: nothing new
+  Result next(SharedInputSample* out)
+  {
+    uint32_t e = ring->epoch.load(std::memory_order_acquire);
+    if(e != epoch) {
+      // producer restarted; anything it was in the middle of will never be finished
+      epoch = e;
+      uint64_t start = ring->epochStart.load(std::memory_order_relaxed);
+      if(readSeq < start)
+        readSeq = start;
+      return Skipped;
+    }
+    uint64_t end = ring->writeSeq.load(std::memory_order_acquire);
+    if(end < readSeq) {
+      readSeq = end;
+      return Skipped;
+    }
+    if(end - readSeq > SHARED_RING_SIZE) {
+      readSeq = end - SHARED_RING_SIZE;
+      return Skipped;
+    }
+    if(end == readSeq)
+      return Empty;
+
+    const SharedInputSlot& slot = ring->slots[readSeq & (SHARED_RING_SIZE - 1)];
+    uint64_t expected = 2*readSeq + 2;
+    ++readSeq;
+    if(slot.seq.load(std::memory_order_acquire) != expected)
+      return Skipped;
+    memcpy(out, &slot.sample, sizeof(SharedInputSample));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // overwritten by producer while we were copying?
+    if(slot.seq.load(std::memory_order_relaxed) != expected)
+      return Skipped;
+    return Sample;
+  }
+
+private:
+  const SharedInputRing* ring;
+  uint64_t readSeq;
+  uint32_t epoch;
+};
+
+#endif
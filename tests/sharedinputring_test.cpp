@@ -0,0 +1,194 @@
+// Synthetic producer/consumer test for the shared input ring; needs no Qt or display
+// Build and run on Linux: g++ -std=c++11 -O2 -I.. sharedinputring_test.cpp -o sharedinputring_test && ./sharedinputring_test
+
+#include "sharedinputring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+    ++failures; } } while(0)
+
+// samples are tagged with their sequence number so reader can verify order and detect torn reads
+static void publish(SharedInputRing* ring, uint64_t& seq)
+{
+  SharedInputSample* sample = sharedRingBeginWrite(ring, seq);
+  sample->type = 0;
+  sample->deviceid = int32_t(seq);
+  sample->npoints = MAX_SHARED_POINTS;
+  for(int ii = 0; ii < MAX_SHARED_POINTS; ++ii) {
+    sample->points[ii].id = ii;
+    sample->points[ii].x = double(seq);
+    sample->points[ii].y = double(seq);
+  }
+  sharedRingEndWrite(ring, seq++);
+}
+
+static bool consistent(const SharedInputSample& sample)
+{
+  for(int ii = 0; ii < MAX_SHARED_POINTS; ++ii) {
+    if(sample.points[ii].x != double(sample.deviceid) || sample.points[ii].y != double(sample.deviceid))
+      return false;
+  }
+  return true;
+}
+
+static SharedInputRing* mapRing()
+{
+  // MAP_SHARED so the forked producer test sees the same memory; anonymous mapping is zero filled
+  void* mem = mmap(NULL, sizeof(SharedInputRing), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+  return static_cast<SharedInputRing*>(mem);
+}
+
+static void testBasic(SharedInputRing* ring)
+{
+  uint64_t seq = sharedRingInit(ring);
+  CHECK(sharedRingValid(ring));
+  SharedInputReader reader;
+  reader.attach(ring);
+  SharedInputSample sample;
+  CHECK(reader.next(&sample) == SharedInputReader::Empty);
+  CHECK(!reader.hasData());
+  uint64_t first = seq;
+  for(int ii = 0; ii < 10; ++ii)
+    publish(ring, seq);
+  CHECK(reader.hasData());
+  for(int ii = 0; ii < 10; ++ii) {
+    CHECK(reader.next(&sample) == SharedInputReader::Sample);
+    CHECK(sample.deviceid == int32_t(first + ii));
+    CHECK(consistent(sample));
+  }
+  CHECK(reader.next(&sample) == SharedInputReader::Empty);
+}
+
+static void testWrap(SharedInputRing* ring)
+{
+  uint64_t seq = sharedRingInit(ring);
+  SharedInputReader reader;
+  reader.attach(ring);
+  SharedInputSample sample;
+  uint64_t expected = seq;
+  // several times around the ring, reading in chunks smaller than the ring, so nothing should be lost
+  for(int chunk = 0; chunk < 20; ++chunk) {
+    for(int ii = 0; ii < SHARED_RING_SIZE/2 + 7; ++ii)
+      publish(ring, seq);
+    SharedInputReader::Result res;
+    while((res = reader.next(&sample)) == SharedInputReader::Sample) {
+      CHECK(sample.deviceid == int32_t(expected));
+      ++expected;
+    }
+    CHECK(res == SharedInputReader::Empty);
+  }
+  CHECK(expected == seq);
+}
+
+static void testOverrun(SharedInputRing* ring)
+{
+  uint64_t seq = sharedRingInit(ring);
+  SharedInputReader reader;
+  reader.attach(ring);
+  SharedInputSample sample;
+  for(int ii = 0; ii < SHARED_RING_SIZE + 50; ++ii)
+    publish(ring, seq);
+  // reader must be told samples were lost, then get exactly the last ring's worth
+  CHECK(reader.next(&sample) == SharedInputReader::Skipped);
+  int count = 0;
+  while(reader.next(&sample) == SharedInputReader::Sample) {
+    CHECK(sample.deviceid == int32_t(seq - SHARED_RING_SIZE + count));
+    ++count;
+  }
+  CHECK(count == SHARED_RING_SIZE);
+}
+
+static void testRestart(SharedInputRing* ring)
+{
+  uint64_t seq = sharedRingInit(ring);
+  SharedInputReader reader;
+  reader.attach(ring);
+  SharedInputSample sample;
+  for(int ii = 0; ii < 5; ++ii)
+    publish(ring, seq);
+  // producer dies with 5 samples unread; new producer takes over the same ring and continues the sequence
+  uint64_t seq2 = sharedRingInit(ring);
+  CHECK(seq2 == seq);
+  for(int ii = 0; ii < 3; ++ii)
+    publish(ring, seq2);
+  CHECK(reader.next(&sample) == SharedInputReader::Skipped);
+  for(int ii = 0; ii < 3; ++ii) {
+    CHECK(reader.next(&sample) == SharedInputReader::Sample);
+    CHECK(sample.deviceid == int32_t(seq + ii));
+  }
+  CHECK(reader.next(&sample) == SharedInputReader::Empty);
+
+  // ring reinitialized from scratch (e.g., incompatible version) - sequence goes backward
+  ring->magic = 0;
+  uint64_t seq3 = sharedRingInit(ring);
+  CHECK(seq3 == 0);
+  publish(ring, seq3);
+  CHECK(reader.next(&sample) == SharedInputReader::Skipped);
+}
+
+// real producer process writing as fast as it can while we read; every sample is either read intact and in
+//  order or reported as skipped
+static void testConcurrent(SharedInputRing* ring)
+{
+  const uint64_t N = 2000000;
+  uint64_t start = sharedRingInit(ring);
+  SharedInputReader reader;
+  reader.attach(ring);
+  pid_t pid = fork();
+  if(pid == 0) {
+    uint64_t seq = start;
+    while(seq < start + N)
+      publish(ring, seq);
+    _exit(0);
+  }
+  SharedInputSample sample;
+  uint64_t nread = 0, nskipped = 0;
+  int64_t last = int64_t(start) - 1;
+  bool torn = false, ordered = true;
+  while(last < int64_t(start + N - 1)) {
+    SharedInputReader::Result res = reader.next(&sample);
+    if(res == SharedInputReader::Sample) {
+      ++nread;
+      torn = torn || !consistent(sample);
+      ordered = ordered && sample.deviceid > last;
+      last = sample.deviceid;
+    }
+    else if(res == SharedInputReader::Skipped)
+      ++nskipped;
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  CHECK(!torn);
+  CHECK(ordered);
+  CHECK(nread > 0);
+  printf("concurrent: %llu read, %llu skip events\n", (unsigned long long)nread, (unsigned long long)nskipped);
+}
+
+int main()
+{
+  SharedInputRing* ring = mapRing();
+  testBasic(ring);
+  testWrap(ring);
+  testOverrun(ring);
+  testRestart(ring);
+  testConcurrent(ring);
+  munmap(ring, sizeof(SharedInputRing));
+  if(failures) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+    return 1;
+  }
+  printf("all tests passed\n");
+  return 0;
+}
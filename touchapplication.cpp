@@ -4,28 +4,81 @@
 #include <QWindow>
 #include <QWidget>
 #include <QTabletEvent>
+#include <QAbstractScrollArea>
+#include <QHeaderView>
+#include <QScrollBar>
+#include <QtMath>
 
 
 int TouchApplication::m_tabletButtons = 0;
 
-TouchApplication::TouchApplication(int& argc, char** argv) : QApplication(argc, argv), inputState(None)
+// kinetic scrolling parameters
+static const qreal FLING_DECAY = 0.05;  // fraction of velocity remaining after 1 sec
+static const qreal MIN_FLING_VELOCITY = 50;  // px/sec
+static const qreal MAX_FLING_VELOCITY = 8000;
+static const int VELOCITY_WINDOW = 100;  // msec of history used to calculate fling velocity
+
+TouchApplication::TouchApplication(int& argc, char** argv) : QApplication(argc, argv), inputState(None),
+    kineticEnabled(false), scrollState(ScrollIdle), lastFrameTime(0), nScrollSamples(0)
 {
   // prevent Qt from handling touch to mouse translation
   QCoreApplication::setAttribute(Qt::AA_SynthesizeMouseForUnhandledTouchEvents, false);
   acceptCount = 0;
+  m_transformCache = new WindowTransformCache(this);
+  inputFilter = NULL;
+  inputBroker = NULL;
+  brokerConsumer = false;
 #ifdef Q_OS_WIN
   // native event filter for handling WM_POINTER messages
-  installNativeEventFilter(new WinInputFilter);
+  inputFilter = new WinInputFilter;
+  installNativeEventFilter(inputFilter);
 #endif
 }
 
-bool TouchApplication::sendMouseEvent(QObject* receiver, QEvent::Type mevtype, QPoint globalpos, Qt::KeyboardModifiers modifiers)
+// returned broker can also be used directly to publish samples, e.g., from a synthetic source
+TouchInputBroker* TouchApplication::startInputBroker(const QString& key)
+{
+  if(!inputBroker) {
+    inputBroker = new TouchInputBroker;
+    if(!inputBroker->create(key)) {
+      delete inputBroker;
+      inputBroker = NULL;
+      return NULL;
+    }
+  }
+  if(inputFilter)
+    inputFilter->setBroker(inputBroker);
+  return inputBroker;
+}
+
+bool TouchApplication::attachInputBroker(const QString& key)
+{
+  SharedInputFilter* filter = new SharedInputFilter;
+  if(!filter->attach(key)) {
+    delete filter;
+    // filter ctor made itself the instance
+    TouchInputFilter::setInstance(inputFilter);
+    return false;
+  }
+  if(inputFilter) {
+    removeNativeEventFilter(inputFilter);
+    delete inputFilter;
+  }
+  inputFilter = filter;
+  installNativeEventFilter(inputFilter);
+  brokerConsumer = true;
+  return true;
+}
+
+bool TouchApplication::sendMouseEvent(QObject* receiver, QEvent::Type mevtype, QPointF globalpos, Qt::KeyboardModifiers modifiers)
 {
-  QPoint localpos = globalpos;
-  if(receiver->isWidgetType())
-    localpos = static_cast<QWidget*>(receiver)->mapFromGlobal(globalpos);
+  QPointF localpos = globalpos;
+  if(receiver->isWidgetType()) {
+    QPoint pt = globalpos.toPoint();
+    localpos = static_cast<QWidget*>(receiver)->mapFromGlobal(pt) + (globalpos - pt);
+  }
   else if(receiver->isWindowType())
-    localpos = static_cast<QWindow*>(receiver)->mapFromGlobal(globalpos);
+    localpos = m_transformCache->mapFromGlobal(static_cast<QWindow*>(receiver), globalpos);
 
   QMouseEvent* mouseevent = new QMouseEvent(mevtype, localpos, globalpos,
       mevtype == QEvent::MouseMove ? Qt::NoButton : Qt::LeftButton,
@@ -45,6 +98,213 @@ bool TouchApplication::sendMouseEvent(QObject* receiver, QEvent::Type mevtype, Q
   return true;
 }
 
+// kinetic scrolling
+// Touch moves only accumulate into pendingScroll; the scroll bars are updated when the target window gets
+//  its next UpdateRequest (see notify()), so we scroll at most once per frame and fling is driven by the
+//  window's frame updates rather than a separate timer
+
+void TouchApplication::setKineticScrolling(bool enable)
+{
+  kineticEnabled = enable;
+  if(!enable)
+    stopKineticScroll();
+}
+
+void TouchApplication::registerScrollable(QWidget* widget, QAbstractSlider* hbar, QAbstractSlider* vbar)
+{
+  ScrollTarget target;
+  target.viewport = widget;
+  target.hbar = hbar;
+  target.vbar = vbar;
+  scrollables.insert(widget, target);
+}
+
+bool TouchApplication::startKineticScroll(QObject* receiver, const QTouchEvent::TouchPoint& touchpt)
+{
+  if(!receiver->isWindowType())
+    return false;
+  QWidget* touched = widgetAt(touchpt.screenPos().toPoint());
+  // receiver may have been redirected to a popup or modal window by getRecvWindow()
+  if(touched && touched->window()->windowHandle() != receiver)
+    touched = NULL;
+  ScrollTarget target;
+  for(QWidget* widget = touched; widget && !target.viewport; widget = widget->parentWidget()) {
+    QHash<QWidget*, ScrollTarget>::const_iterator it = scrollables.constFind(widget);
+    if(it != scrollables.constEnd())
+      target = it.value();
+    else if(QAbstractScrollArea* area = qobject_cast<QAbstractScrollArea*>(widget)) {
+      // only scroll for touches on content, not the area's scroll bars, corner widget, or headers
+      QWidget* vp = area->viewport();
+      if(qobject_cast<QHeaderView*>(area) || (touched != vp && !vp->isAncestorOf(touched)))
+        break;
+      target.viewport = vp;
+      target.hbar = area->horizontalScrollBar();
+      target.vbar = area->verticalScrollBar();
+    }
+    if(target.viewport && !(target.hbar && target.hbar->maximum() > target.hbar->minimum())
+        && !(target.vbar && target.vbar->maximum() > target.vbar->minimum()))
+      target = ScrollTarget();  // nothing to scroll - keep looking
+  }
+  // touching a flinging scroll area just stops it
+  bool catchfling = scrollState == ScrollFling && target.viewport == scrollTarget.viewport;
+  stopKineticScroll();
+  if(!target.viewport)
+    return false;
+
+  if(!scrollTimer.isValid())
+    scrollTimer.start();
+  scrollTarget = target;
+  scrollWindow = static_cast<QWindow*>(receiver);
+  scrollState = catchfling ? ScrollDrag : ScrollPending;
+  scrollStartPos = touchpt.screenPos();
+  scrollLastPos = scrollStartPos;
+  nScrollSamples = 0;
+  addScrollSample(scrollStartPos);
+  return true;
+}
+
+void TouchApplication::stopKineticScroll()
+{
+  scrollState = ScrollIdle;
+  pendingScroll = QPointF();
+  scrollVelocity = QPointF();
+  scrollRemainder = QPointF();
+  scrollTarget = ScrollTarget();
+  scrollWindow = NULL;
+}
+
+void TouchApplication::addScrollSample(const QPointF& pos)
+{
+  ScrollSample& sample = scrollHistory[nScrollSamples % SCROLL_HISTORY];
+  sample.time = scrollTimer.elapsed();
+  sample.pos = pos;
+  ++nScrollSamples;
+}
+
+QPointF TouchApplication::flingVelocity() const
+{
+  // if finger was held still before release, there will be no other samples in window, so no fling
+  const ScrollSample& newest = scrollHistory[(nScrollSamples - 1) % SCROLL_HISTORY];
+  const ScrollSample* oldest = &newest;
+  for(int ii = 2; ii <= qMin(nScrollSamples, int(SCROLL_HISTORY)); ++ii) {
+    const ScrollSample& sample = scrollHistory[(nScrollSamples - ii) % SCROLL_HISTORY];
+    if(newest.time - sample.time > VELOCITY_WINDOW)
+      break;
+    oldest = &sample;
+  }
+  if(newest.time <= oldest->time)
+    return QPointF();
+  // scrolling moves content opposite to finger
+  QPointF v = (oldest->pos - newest.pos)*(1000.0/(newest.time - oldest->time));
+  return QPointF(qBound(-MAX_FLING_VELOCITY, v.x(), MAX_FLING_VELOCITY),
+      qBound(-MAX_FLING_VELOCITY, v.y(), MAX_FLING_VELOCITY));
+}
+
+// handle touch events for sequence in TouchScroll state
+bool TouchApplication::kineticTouchEvent(QObject* receiver, QTouchEvent* touchevent, QEvent::Type evtype)
+{
+  touchevent->setAccepted(true);
+  QList<QTouchEvent::TouchPoint> touchPoints = touchevent->touchPoints();
+  for(int ii = 0; ii < touchPoints.count(); ++ii) {
+    const QTouchEvent::TouchPoint& touchpt = touchPoints.at(ii);
+    if(touchpt.id() != activeTouchId)
+      continue;
+    QPointF pos = touchpt.screenPos();
+    addScrollSample(pos);
+    if(scrollState == ScrollPending) {
+      QPointF d = pos - scrollStartPos;
+      if(qMax(qAbs(d.x()), qAbs(d.y())) >= startDragDistance()) {
+        scrollState = ScrollDrag;
+        scrollLastPos = scrollStartPos;
+      }
+    }
+    if(scrollState == ScrollDrag) {
+      pendingScroll += scrollLastPos - pos;
+      scrollLastPos = pos;
+      if(scrollWindow)
+        scrollWindow->requestUpdate();
+    }
+    if(touchpt.state() == Qt::TouchPointReleased) {
+      activeTouchId = -1;
+      inputState = None;
+      if(scrollState == ScrollPending) {
+        // never moved far enough to scroll, so treat as a click
+        stopKineticScroll();
+        sendMouseEvent(receiver, QEvent::MouseButtonPress, scrollStartPos, touchevent->modifiers());
+        return sendMouseEvent(receiver, QEvent::MouseButtonRelease, pos, touchevent->modifiers());
+      }
+      scrollVelocity = flingVelocity();
+      if(scrollState == ScrollDrag && qMax(qAbs(scrollVelocity.x()), qAbs(scrollVelocity.y())) >= MIN_FLING_VELOCITY) {
+        scrollState = ScrollFling;
+        lastFrameTime = scrollTimer.elapsed();
+        if(scrollWindow)
+          scrollWindow->requestUpdate();
+      }
+      else if(pendingScroll.isNull())
+        stopKineticScroll();
+      // else ScrollDrag remains until pending scroll is applied on next frame
+    }
+    break;
+  }
+  // sequence ended (e.g. cancelled) without release of our touch point
+  if(evtype == QEvent::TouchEnd && inputState == TouchScroll) {
+    activeTouchId = -1;
+    inputState = None;
+    if(scrollState == ScrollPending)
+      stopKineticScroll();
+  }
+  return true;
+}
+
+// returns false if bar hit the end of its range
+bool TouchApplication::applyScroll(QAbstractSlider* bar, qreal dpix, int extent, qreal& remainder)
+{
+  if(!bar || dpix == 0 || extent <= 0)
+    return true;
+  // pageStep corresponds to viewport extent, so this also works for item views scrolling per item
+  qreal val = bar->value() + remainder + dpix*bar->pageStep()/extent;
+  int ival = qRound(val);
+  int bounded = qBound(bar->minimum(), ival, bar->maximum());
+  remainder = bounded == ival ? val - ival : 0;
+  bar->setValue(bounded);
+  return bounded == ival;
+}
+
+void TouchApplication::scrollFrame()
+{
+  if(!scrollTarget.viewport) {
+    stopKineticScroll();
+    return;
+  }
+  qint64 now = scrollTimer.elapsed();
+  // limit step in case frames were delayed
+  qreal dt = qMin(now - lastFrameTime, qint64(50))/1000.0;
+  lastFrameTime = now;
+
+  QPointF delta = pendingScroll;
+  pendingScroll = QPointF();
+  if(scrollState == ScrollFling) {
+    delta = scrollVelocity*dt;
+    scrollVelocity *= qPow(FLING_DECAY, dt);
+  }
+  QWidget* vp = scrollTarget.viewport;
+  qreal rx = scrollRemainder.x(), ry = scrollRemainder.y();
+  if(!applyScroll(scrollTarget.hbar, delta.x(), vp->width(), rx))
+    scrollVelocity.setX(0);
+  if(!applyScroll(scrollTarget.vbar, delta.y(), vp->height(), ry))
+    scrollVelocity.setY(0);
+  scrollRemainder = QPointF(rx, ry);
+
+  if(scrollState == ScrollFling) {
+    if(qMax(qAbs(scrollVelocity.x()), qAbs(scrollVelocity.y())) < MIN_FLING_VELOCITY)
+      stopKineticScroll();
+    else if(scrollWindow)
+      scrollWindow->requestUpdate();
+  }
+  else if(scrollState == ScrollDrag && inputState != TouchScroll)
+    stopKineticScroll();  // finger was lifted without fling and final pending scroll has now been applied
+}
+
 QObject* TouchApplication::getRecvWindow(QObject* candidate)
 {
   if(candidate->isWindowType()) {
@@ -65,6 +325,26 @@ bool TouchApplication::notify(QObject* receiver, QEvent* event)
 {
   //DebugEventFilter::printEvent(receiver, event);
   QEvent::Type evtype = event->type();
+  // step kinetic scrolling once per frame of target window, then let window handle UpdateRequest normally
+  if(evtype == QEvent::UpdateRequest && scrollState != ScrollIdle && receiver == scrollWindow.data())
+    scrollFrame();
+  // with broker, all touch and tablet input comes from the ring (sent to window as non-spontaneous events),
+  //  so drop anything Qt decoded itself; QWidgetWindow forwards our events to widgets as spontaneous, so only
+  //  check events sent to windows
+  if(brokerConsumer && event->spontaneous() && receiver->isWindowType()) {
+    switch(evtype) {
+    case QEvent::TouchBegin:
+    case QEvent::TouchUpdate:
+    case QEvent::TouchEnd:
+    case QEvent::TouchCancel:
+    case QEvent::TabletPress:
+    case QEvent::TabletMove:
+    case QEvent::TabletRelease:
+      return true;
+    default:
+      break;
+    }
+  }
   // first, try to pass TabletPress/TouchBegin event and see if anyone accepts it
   // In Qt, events are first sent to a QWindow, which then figures out what widget they should be sent to.
   // Unfortunately, QWindow event handler always returns true and doesn't change accepted state of event (it
@@ -130,7 +410,7 @@ bool TouchApplication::notify(QObject* receiver, QEvent* event)
       mevtype = QEvent::MouseButtonRelease;
       inputState = None;
     }
-    return sendMouseEvent(receiver, mevtype, tabletevent->globalPos(), tabletevent->modifiers());
+    return sendMouseEvent(receiver, mevtype, tabletevent->globalPosF(), tabletevent->modifiers());
   }
 #ifdef QT_5
   case QEvent::TouchCancel:
@@ -148,9 +428,16 @@ bool TouchApplication::notify(QObject* receiver, QEvent* event)
     if(inputState == None && evtype == QEvent::TouchBegin
         && touchevent->touchPoints().size() == 1 && touchevent->device()->type() != QTouchDevice::TouchPad) {
       activeTouchId = touchevent->touchPoints().first().id();
+      if(kineticEnabled && startKineticScroll(receiver, touchevent->touchPoints().first())) {
+        inputState = TouchScroll;
+        event->setAccepted(true);
+        return true;
+      }
       mevtype = QEvent::MouseButtonPress;
       inputState = TouchInput;
     }
+    else if(inputState == TouchScroll)
+      return kineticTouchEvent(receiver, touchevent, evtype);
     else if(inputState != TouchInput)  // this covers PassThru
       break;
     if(evtype == QEvent::TouchEnd)
@@ -164,7 +451,7 @@ bool TouchApplication::notify(QObject* receiver, QEvent* event)
           mevtype = QEvent::MouseButtonRelease;
           activeTouchId = -1;
         }
-        return sendMouseEvent(receiver, mevtype, touchpt.screenPos().toPoint(), touchevent->modifiers());
+        return sendMouseEvent(receiver, mevtype, touchpt.screenPos(), touchevent->modifiers());
       }
     }
     // swallow all touch events until TouchEnd
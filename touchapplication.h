@@ -2,6 +2,16 @@
 #define TOUCHAPPLICATION_H
 
 #include <QApplication>
+#include <QPointer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QTouchEvent>
+
+class WindowTransformCache;
+class TouchInputFilter;
+class TouchInputBroker;
+class QAbstractSlider;
+class QWindow;
 
 class TouchApplication : public QApplication
 {
@@ -12,14 +22,65 @@ public:
 
   static int tabletButtons() { return m_tabletButtons; }
   static void setTabletButtons(int btns) { m_tabletButtons = btns; }
+  WindowTransformCache* transformCache() { return m_transformCache; }
+
+  // kinetic scrolling for single touch sequences on QAbstractScrollArea or registered scrollable widgets;
+  //  drag and fling are applied to the scroll bars (either may be NULL) once per frame of the target window
+  bool kineticScrolling() const { return kineticEnabled; }
+  void setKineticScrolling(bool enable);
+  void registerScrollable(QWidget* widget, QAbstractSlider* hbar, QAbstractSlider* vbar);
+  void unregisterScrollable(QWidget* widget) { scrollables.remove(widget); }
+
+  // broker mode: startInputBroker() publishes input decoded by this process to shared memory under key;
+  //  attachInputBroker() replaces this process's input decoding with samples read from a broker's ring.
+  //  Both fail except on Windows, and startInputBroker() requires UIAccess (see TouchInputBroker)
+  TouchInputBroker* startInputBroker(const QString& key);
+  bool attachInputBroker(const QString& key);
 
 private:
-  bool sendMouseEvent(QObject* receiver, QEvent::Type mevtype, QPoint globalpos, Qt::KeyboardModifiers modifiers);
+  struct ScrollTarget
+  {
+    QPointer<QWidget> viewport;
+    QPointer<QAbstractSlider> hbar;
+    QPointer<QAbstractSlider> vbar;
+  };
+
+  bool startKineticScroll(QObject* receiver, const QTouchEvent::TouchPoint& touchpt);
+  bool kineticTouchEvent(QObject* receiver, QTouchEvent* touchevent, QEvent::Type evtype);
+  void stopKineticScroll();
+  void addScrollSample(const QPointF& pos);
+  QPointF flingVelocity() const;
+  void scrollFrame();
+  bool applyScroll(QAbstractSlider* bar, qreal dpix, int extent, qreal& remainder);
+
+  bool sendMouseEvent(QObject* receiver, QEvent::Type mevtype, QPointF globalpos, Qt::KeyboardModifiers modifiers);
   QObject* getRecvWindow(QObject* candidate);
 
   int activeTouchId;
   int acceptCount;
-  enum {None, PassThru, TouchInput, TabletInput} inputState;
+  enum {None, PassThru, TouchInput, TabletInput, TouchScroll} inputState;
+  WindowTransformCache* m_transformCache;
+  TouchInputFilter* inputFilter;
+  TouchInputBroker* inputBroker;
+  bool brokerConsumer;
+
+  bool kineticEnabled;
+  QHash<QWidget*, ScrollTarget> scrollables;
+  ScrollTarget scrollTarget;
+  QPointer<QWindow> scrollWindow;
+  // Pending: touch is down but hasn't moved far enough to scroll, so release will be sent as a click
+  enum {ScrollIdle, ScrollPending, ScrollDrag, ScrollFling} scrollState;
+  QPointF scrollStartPos;
+  QPointF scrollLastPos;
+  QPointF pendingScroll;  // drag distance accumulated since last frame
+  QPointF scrollVelocity;  // px/sec
+  QPointF scrollRemainder;  // sub-unit part of scroll bar position
+  QElapsedTimer scrollTimer;
+  qint64 lastFrameTime;
+  struct ScrollSample { qint64 time; QPointF pos; };
+  enum { SCROLL_HISTORY = 8 };
+  ScrollSample scrollHistory[SCROLL_HISTORY];
+  int nScrollSamples;
   static int m_tabletButtons;
 };
 
@@ -5,6 +5,30 @@
 #include <QDesktopWidget>
 #include <QWindow>
 #include <QScreen>
+#include <QTimer>
+#include <QDir>
+#include <QLockFile>
+
+// pos is in native pixels; with Qt high DPI scaling, screen origin is the same in native and device
+//  independent pixels, but size is scaled by devicePixelRatio
+static QScreen* nativeScreenAt(const QPoint& pos)
+{
+  foreach(QScreen* screen, QGuiApplication::screens()) {
+    QRect geom = screen->geometry();
+    if(QRectF(geom.topLeft(), QSizeF(geom.size())*screen->devicePixelRatio()).contains(pos))
+      return screen;
+  }
+  return QGuiApplication::primaryScreen();
+}
+
+// physicalDotsPerInch is per device independent pixel, so calculate from native size instead
+static qreal nativePixelsPerMM(QScreen* screen)
+{
+  QSizeF physsize = screen->physicalSize();
+  if(physsize.width() > 0)
+    return screen->geometry().width()*screen->devicePixelRatio()/physsize.width();
+  return screen->logicalDotsPerInch()*screen->devicePixelRatio()/25.4;
+}
 
 #ifdef Q_OS_WIN
 
@@ -16,22 +40,28 @@
 // WM_POINTER functions
 typedef BOOL (WINAPI *PtrGetPointerInfo)(UINT32, POINTER_INFO*);
 typedef BOOL (WINAPI *PtrGetPointerFrameInfo)(UINT32, UINT32*, POINTER_INFO*);
+typedef BOOL (WINAPI *PtrGetPointerFrameTouchInfo)(UINT32, UINT32*, POINTER_TOUCH_INFO*);
 typedef BOOL (WINAPI *PtrGetPointerPenInfo)(UINT32, POINTER_PEN_INFO*);
 typedef BOOL (WINAPI *PtrGetPointerPenInfoHistory)(UINT32, UINT32*, POINTER_PEN_INFO*);
 typedef BOOL (WINAPI *PtrInjectTouchInput)(UINT32, POINTER_TOUCH_INFO*);
 typedef BOOL (WINAPI *PtrInitializeTouchInjection)(UINT32, DWORD);
+typedef BOOL (WINAPI *PtrRegisterPointerInputTarget)(HWND, POINTER_INPUT_TYPE);
+typedef BOOL (WINAPI *PtrUnregisterPointerInputTarget)(HWND, POINTER_INPUT_TYPE);
 
 static PtrGetPointerInfo GetPointerInfo;
 static PtrGetPointerFrameInfo GetPointerFrameInfo;
+static PtrGetPointerFrameTouchInfo GetPointerFrameTouchInfo;
 static PtrGetPointerPenInfo GetPointerPenInfo;
 static PtrGetPointerPenInfoHistory GetPointerPenInfoHistory;
 static PtrInjectTouchInput InjectTouchInput;
 static PtrInitializeTouchInjection InitializeTouchInjection;
+static PtrRegisterPointerInputTarget RegisterPointerInputTarget;
+static PtrUnregisterPointerInputTarget UnregisterPointerInputTarget;
 
-static qreal HimetricToPix;
 #define MAX_N_POINTERS 10
 static POINTER_INFO pointerInfo[MAX_N_POINTERS];
 static POINTER_PEN_INFO penPointerInfo[MAX_N_POINTERS];
+static POINTER_TOUCH_INFO touchPointerInfo[MAX_N_POINTERS];
 
 #ifdef USE_WINTAB
 #include <windows.h>
@@ -153,6 +183,7 @@ static bool winTabEvent(MSG* msg, long* result)
       gpWTOverlap(hTab, TRUE);
     break; */
   case WT_PROXIMITY:
+    TouchInputFilter::instance()->notifyPenProximity();
     // only handle proximity enter
     if(LOWORD(msg->lParam) != 0) {
       LOGCONTEXTA lc;
@@ -190,21 +221,16 @@ static void processPenInfo(const POINTER_PEN_INFO& ppi, QEvent::Type eventtype)
       = (ppi.penFlags & PEN_FLAG_ERASER) ? QTabletEvent::Eraser : QTabletEvent::Pen;
 
   // unfortunately, there doesn't seem to be any reliable way to figure out himetric to pixel mapping,
-  //  so just calculate it from first point we see
-  const POINT pix = ppi.pointerInfo.ptPixelLocation;
-  const POINT him = ppi.pointerInfo.ptHimetricLocation;
-  qreal x = him.x*HimetricToPix;
-  qreal y = him.y*HimetricToPix;
-  if(pix.x < x - 1 || pix.x > x + 1 || pix.y < y - 1 || pix.y > y + 1) {
-    HimetricToPix = qreal(pix.x)/him.x;
-    x = him.x*HimetricToPix;
-    y = him.y*HimetricToPix;
-  }
+  //  so it is calibrated from the samples we see on each screen
+  const QPoint pix(ppi.pointerInfo.ptPixelLocation.x, ppi.pointerInfo.ptPixelLocation.y);
+  const QPoint him(ppi.pointerInfo.ptHimetricLocation.x, ppi.pointerInfo.ptHimetricLocation.y);
+  WindowTransformCache* cache = static_cast<TouchApplication*>(QApplication::instance())->transformCache();
+  QPointF pos = cache->mapHimetric(nativeScreenAt(pix), him, pix);
   // Confirmed that HIMETRIC is higher resolution than pixel location on Surface Pro: saw different HIMETRIC
   //  locations for the same pixel loc, including updates to HIMETRIC loc with no change in pixel loc
   //qDebug("Pix: %d %d; HIMETRIC: %d %d", pix.x, pix.y, him.x, him.y);
 
-  TouchInputFilter::instance()->notifyTabletEvent(eventtype, QPointF(x, y), ppi.pressure/1024.0, ptrtype,
+  TouchInputFilter::instance()->notifyTabletEvent(eventtype, pos, ppi.pressure/1024.0, ptrtype,
       ppi.penFlags & PEN_FLAG_BARREL, int(ppi.pointerInfo.sourceDevice));
 }
 
@@ -230,15 +256,26 @@ static void processPenHistory(UINT32 ptrid)
 static bool processPointerFrame(UINT32 ptrid, Qt::TouchPointState eventtype)
 {
   UINT32 pointercount = MAX_N_POINTERS;
-  if(GetPointerFrameInfo(ptrid, &pointercount, &pointerInfo[0])) {
+  // GetPointerFrameTouchInfo gives us contact area (needed for palm rejection) but fails for non-touch pointers
+  bool hastouchinfo = GetPointerFrameTouchInfo
+      && GetPointerFrameTouchInfo(ptrid, &pointercount, &touchPointerInfo[0]);
+  if(!hastouchinfo)
+    pointercount = MAX_N_POINTERS;
+  if(hastouchinfo || GetPointerFrameInfo(ptrid, &pointercount, &pointerInfo[0])) {
     QList<QTouchEvent::TouchPoint> pts;
     for(unsigned int ii = 0; ii < pointercount; ii++) {
-      if(pointerInfo[ii].pointerType != PT_TOUCH)
+      const POINTER_INFO& info = hastouchinfo ? touchPointerInfo[ii].pointerInfo : pointerInfo[ii];
+      if(info.pointerType != PT_TOUCH)
         continue;
       QTouchEvent::TouchPoint pt;
-      pt.setId(pointerInfo[ii].pointerId);
-      pt.setState(pointerInfo[ii].pointerId == ptrid ? eventtype : Qt::TouchPointMoved);
-      pt.setScreenPos(QPointF(pointerInfo[ii].ptPixelLocation.x, pointerInfo[ii].ptPixelLocation.y));
+      pt.setId(info.pointerId);
+      pt.setState(info.pointerId == ptrid ? eventtype : Qt::TouchPointMoved);
+      // setScreenRect also sets screenPos in recent Qt versions, so call it first
+      if(hastouchinfo && (touchPointerInfo[ii].touchMask & TOUCH_MASK_CONTACTAREA)) {
+        const RECT& rc = touchPointerInfo[ii].rcContact;
+        pt.setScreenRect(QRectF(rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top));
+      }
+      pt.setScreenPos(QPointF(info.ptPixelLocation.x, info.ptPixelLocation.y));
       pt.setPressure(1);
       pts.append(pt);
     }
@@ -257,17 +294,15 @@ static void initWMPointer()
   if(user32) {
     GetPointerInfo = (PtrGetPointerInfo)(GetProcAddress(user32, "GetPointerInfo"));
     GetPointerFrameInfo = (PtrGetPointerFrameInfo)(GetProcAddress(user32, "GetPointerFrameInfo"));
+    GetPointerFrameTouchInfo = (PtrGetPointerFrameTouchInfo)(GetProcAddress(user32, "GetPointerFrameTouchInfo"));
     GetPointerPenInfo = (PtrGetPointerPenInfo)(GetProcAddress(user32, "GetPointerPenInfo"));
     GetPointerPenInfoHistory = (PtrGetPointerPenInfoHistory)(GetProcAddress(user32, "GetPointerPenInfoHistory"));
     InjectTouchInput = (PtrInjectTouchInput)(GetProcAddress(user32, "InjectTouchInput"));
     InitializeTouchInjection = (PtrInitializeTouchInjection)(GetProcAddress(user32, "InitializeTouchInjection"));
+    RegisterPointerInputTarget = (PtrRegisterPointerInputTarget)(GetProcAddress(user32, "RegisterPointerInputTarget"));
+    UnregisterPointerInputTarget =
+        (PtrUnregisterPointerInputTarget)(GetProcAddress(user32, "UnregisterPointerInputTarget"));
   }
-
-  // Attempt to get HIMETRIC to pixel conversion factor; on Surface Pro, result is close, but not quite
-  // 1 HIMETRIC = 0.01 mm
-  QWidget* screen = QApplication::desktop()->screen(0);
-  // this is equiv to GetDeviceCaps(HORZRES)/GetDeviceCaps(HORZSIZE)
-  HimetricToPix = screen->width()/qreal(100*screen->widthMM());
 }
 
 static bool winInputEvent(MSG* m, long* result)
@@ -278,6 +313,12 @@ static bool winInputEvent(MSG* m, long* result)
   if(!GetPointerInfo)
     return false;
   switch(m->message) {
+  // pen proximity is used for palm rejection; let Qt see these messages too
+  case WM_POINTERENTER:
+  case WM_POINTERLEAVE:
+    if(GetPointerInfo(GET_POINTERID_WPARAM(m->wParam), &pointerInfo[0]) && pointerInfo[0].pointerType == PT_PEN)
+      TouchInputFilter::instance()->notifyPenProximity();
+    break;
   // WM_POINTER:
   // WM_POINTERDOWN with type PT_PEN: ignore all other pointers, use GetPointerPenInfoHistory
   // otherwise, use GetPointerFrameInfo (discard history)
@@ -298,9 +339,13 @@ static bool winInputEvent(MSG* m, long* result)
       processPenHistory(penPointerId);
       return true;
     }
-    else
-      return processPointerFrame(GET_POINTERID_WPARAM(m->wParam), Qt::TouchPointMoved);
-    break;
+    // hovering pen never reaches notifyTabletEvent, so refresh proximity here (touch is always in contact)
+    if(!IS_POINTER_INCONTACT_WPARAM(m->wParam)) {
+      if(GetPointerInfo(GET_POINTERID_WPARAM(m->wParam), &pointerInfo[0]) && pointerInfo[0].pointerType == PT_PEN)
+        TouchInputFilter::instance()->notifyPenProximity();
+      return false;
+    }
+    return processPointerFrame(GET_POINTERID_WPARAM(m->wParam), Qt::TouchPointMoved);
   case WM_POINTERUP:
     if(penPointerId && penPointerId == GET_POINTERID_WPARAM(m->wParam)) {
       if(GetPointerPenInfo(penPointerId, &penPointerInfo[0]))
@@ -347,7 +392,9 @@ bool WinInputFilter::nativeEventFilter(const QByteArray& eventType, void* messag
 
 TouchInputFilter* TouchInputFilter::m_instance = NULL;
 
-TouchInputFilter::TouchInputFilter() : tabletTarget(NULL), touchTarget(NULL)
+TouchInputFilter::TouchInputFilter() : tabletTarget(NULL), touchTarget(NULL), broker(NULL),
+    lastTabletType(QTabletEvent::Pen), lastTabletDevice(0), nextContact(0), numContacts(0),
+    penLastSeen(-1), palmRejectEnabled(false)
 {
   touchApp = static_cast<TouchApplication*>(QApplication::instance());
   m_instance = this;
@@ -356,11 +403,103 @@ TouchInputFilter::TouchInputFilter() : tabletTarget(NULL), touchTarget(NULL)
   touchDevice.setName("WM_POINTER");
   touchDevice.setType(QTouchDevice::TouchScreen);
   touchDevice.setCapabilities(QTouchDevice::Position | QTouchDevice::Pressure);
+
+  inputTimer.start();
+  // a fingertip contact is typically under 10 mm across; a palm, or the side of a hand, is much larger
+  maxContactSize = 16;
+  clusterRadius = 40;
+  clusterCount = 2;  // reject 3rd contact landing within clusterRadius and clusterWindow
+  clusterWindow = 250;
+  palmRegionWindow = 500;
+  penGuardTime = 500;
 }
 
 TouchInputFilter::~TouchInputFilter()
 {
   delete helperObject;
+  if(m_instance == this)
+    m_instance = NULL;
+}
+
+// palm rejection
+// Rejection is decided once, when a contact goes down; after that, all points with a rejected id are removed
+//  from every frame until released, so rejected contacts never reach topLevelAt(), notify(), or mouse
+//  translation.  Contact size is only available if the platform code sets TouchPoint::screenRect
+// We don't track pen proximity state: leaving range may be reported to another process's window, so we'd
+//  never see it.  Instead every pen message (incl. hover) refreshes penLastSeen and we reject touches for
+//  penGuardTime after that
+
+void TouchInputFilter::notifyPenProximity()
+{
+  penLastSeen = inputTimer.elapsed();
+}
+
+void TouchInputFilter::recordContact(const QTouchEvent::TouchPoint& pt, qint64 now, bool rejected)
+{
+  RecentContact& c = recentContacts[nextContact];
+  c.pos = pt.screenPos();
+  c.time = now;
+  c.rejected = rejected;
+  nextContact = (nextContact + 1) % MAX_RECENT_CONTACTS;
+  numContacts = qMin(numContacts + 1, int(MAX_RECENT_CONTACTS));
+}
+
+bool TouchInputFilter::rejectContact(const QTouchEvent::TouchPoint& pt, qint64 now)
+{
+  if(penLastSeen >= 0 && now - penLastSeen < penGuardTime)
+    return true;
+  // positions and contact size are in native pixels, so convert thresholds using the contact's screen
+  qreal pxpermm = nativePixelsPerMM(nativeScreenAt(pt.screenPos().toPoint()));
+  QSizeF size = pt.screenRect().size();
+  if(size.width() > maxContactSize*pxpermm || size.height() > maxContactSize*pxpermm)
+    return true;
+
+  // walk recent contacts newest to oldest, stopping at first one outside the largest time window
+  const qreal r2 = clusterRadius*clusterRadius*pxpermm*pxpermm;
+  const int maxwindow = qMax(clusterWindow, palmRegionWindow);
+  int nclustered = 0;
+  for(int ii = 1; ii <= numContacts; ++ii) {
+    const RecentContact& c = recentContacts[(nextContact - ii + MAX_RECENT_CONTACTS) % MAX_RECENT_CONTACTS];
+    qint64 dt = now - c.time;
+    if(dt > maxwindow)
+      break;
+    QPointF d = pt.screenPos() - c.pos;
+    if(d.x()*d.x() + d.y()*d.y() > r2)
+      continue;
+    // contacts landing near a recently rejected contact are probably the same hand
+    if(c.rejected && dt < palmRegionWindow)
+      return true;
+    if(dt < clusterWindow && ++nclustered >= clusterCount)
+      return true;
+  }
+  return false;
+}
+
+// removes rejected points from frame; returns false if nothing is left to deliver
+bool TouchInputFilter::filterRejected(Qt::TouchPointStates& touchstate, QList<QTouchEvent::TouchPoint>& points)
+{
+  qint64 now = inputTimer.elapsed();
+  for(int ii = points.count() - 1; ii >= 0; --ii) {
+    const QTouchEvent::TouchPoint& pt = points[ii];
+    bool rejected = rejectedIds.contains(pt.id());
+    if(pt.state() == Qt::TouchPointPressed) {
+      // Windows reuses pointer ids, so a rejected id still present here means we missed its release
+      rejectedIds.remove(pt.id());
+      rejected = palmRejectEnabled && rejectContact(pt, now);
+      recordContact(pt, now, rejected);
+      if(rejected)
+        rejectedIds.insert(pt.id());
+    }
+    if(rejected) {
+      if(pt.state() == Qt::TouchPointReleased)
+        rejectedIds.remove(pt.id());
+      // point generating this frame was rejected, so remaining points (if any) are just moves
+      if(pt.state() != Qt::TouchPointMoved)
+        touchstate = Qt::TouchPointMoved;
+      points.removeAt(ii);
+    }
+  }
+  return !points.isEmpty();
 }
 
 // functions for direct injection of tablet and touch events (only used on Windows at the moment)
@@ -368,6 +507,10 @@ TouchInputFilter::~TouchInputFilter()
 void TouchInputFilter::notifyTabletEvent(QEvent::Type eventtype,
     const QPointF& globalpos, qreal pressure, QTabletEvent::PointerType ptrtype, int buttons, int deviceid)
 {
+  penLastSeen = inputTimer.elapsed();
+  // sample may belong to another process
+  if(broker && !broker->publishTablet(eventtype, globalpos, pressure, ptrtype, buttons, deviceid))
+    return;
   if(eventtype == QEvent::TabletPress || !tabletTarget) {
     tabletTarget = QGuiApplication::topLevelAt(globalpos.toPoint());
     if(!tabletTarget)
@@ -380,7 +523,10 @@ void TouchInputFilter::notifyTabletEvent(QEvent::Type eventtype,
     tabletTarget = NULL;
   }
 
-  QPointF localpos = window->mapFromGlobal(globalpos.toPoint()) + (globalpos - globalpos.toPoint());
+  lastTabletPos = globalpos;
+  lastTabletType = ptrtype;
+  lastTabletDevice = deviceid;
+  QPointF localpos = touchApp->transformCache()->mapFromGlobal(window, globalpos);
   QTabletEvent tabletevent(eventtype, localpos, globalpos, deviceid , ptrtype,
                            pressure, 0, 0, 0, 0, 0, QApplication::keyboardModifiers(), deviceid);
   touchApp->setTabletButtons(buttons);
@@ -391,6 +537,10 @@ void TouchInputFilter::notifyTouchEvent(
     Qt::TouchPointStates touchstate, const QList<QTouchEvent::TouchPoint>& _points)
 {
   QList<QTouchEvent::TouchPoint> points = _points;
+  if(!filterRejected(touchstate, points))
+    return;
+  if(broker && !broker->publishTouch(touchstate, points))
+    return;
   QEvent::Type evtype = QEvent::TouchUpdate;
   if(touchstate == Qt::TouchPointPressed && !touchTarget) {
     touchTarget = QGuiApplication::topLevelAt(points[0].screenPos().toPoint());
@@ -409,15 +559,168 @@ void TouchInputFilter::notifyTouchEvent(
   if(points.count() > 1)
     touchstate |= Qt::TouchPointMoved;
 
+  // TODO: handle last, start position stuff by saving previous list of touch points
+  touchApp->transformCache()->mapFromGlobal(window, points);
+  lastTouchPoints.clear();
   for(int ii = 0; ii < points.count(); ++ii) {
-    points[ii].setPos(window->mapFromGlobal(points[ii].screenPos().toPoint()));
-    // TODO: handle last, start position stuff by saving previous list of touch points
+    if(points[ii].state() != Qt::TouchPointReleased)
+      lastTouchPoints.append(points[ii]);
   }
 
   QTouchEvent touchevent(evtype, &touchDevice, QApplication::keyboardModifiers(), touchstate, points);
   touchApp->notify(window, &touchevent);
 }
 
+// sends release for last points seen, so TouchApplication sees a normal end of sequence (incl. mouse release)
+void TouchInputFilter::cancelInput()
+{
+  rejectedIds.clear();
+  if(touchTarget) {
+    QWindow* window = touchTarget;
+    QObject::disconnect(touchTarget, SIGNAL(destroyed()), helperObject, SLOT(touchWindowDestroyed()));
+    touchTarget = NULL;
+    QList<QTouchEvent::TouchPoint> points = lastTouchPoints;
+    lastTouchPoints.clear();
+    for(int ii = 0; ii < points.count(); ++ii)
+      points[ii].setState(Qt::TouchPointReleased);
+    QTouchEvent touchevent(QEvent::TouchEnd, &touchDevice, QApplication::keyboardModifiers(),
+        Qt::TouchPointReleased, points);
+    touchApp->notify(window, &touchevent);
+  }
+  if(tabletTarget) {
+    // tabletTarget is cleared by release; don't publish synthetic release
+    TouchInputBroker* b = broker;
+    broker = NULL;
+    notifyTabletEvent(QEvent::TabletRelease, lastTabletPos, 0, lastTabletType, 0, lastTabletDevice);
+    broker = b;
+  }
+}
+
+// WindowTransformCache
+
+const QTransform& WindowTransformCache::fromGlobal(QWindow* window)
+{
+  TransformKey key(window, window->screen());
+  QHash<TransformKey, QTransform>::iterator it = transforms.find(key);
+  if(it != transforms.end())
+    return it.value();
+
+  // mapFromGlobal is affine, so three points are enough to recover the full mapping
+  const int d = 1024;
+  QPointF o = window->mapFromGlobal(QPoint(0, 0));
+  QPointF ex = (window->mapFromGlobal(QPoint(d, 0)) - o)/qreal(d);
+  QPointF ey = (window->mapFromGlobal(QPoint(0, d)) - o)/qreal(d);
+  connect(window, SIGNAL(xChanged(int)), this, SLOT(windowChanged()), Qt::UniqueConnection);
+  connect(window, SIGNAL(yChanged(int)), this, SLOT(windowChanged()), Qt::UniqueConnection);
+  connect(window, SIGNAL(widthChanged(int)), this, SLOT(windowChanged()), Qt::UniqueConnection);
+  connect(window, SIGNAL(heightChanged(int)), this, SLOT(windowChanged()), Qt::UniqueConnection);
+  connect(window, SIGNAL(screenChanged(QScreen*)), this, SLOT(windowChanged()), Qt::UniqueConnection);
+  connect(window, SIGNAL(destroyed(QObject*)), this, SLOT(windowDestroyed(QObject*)), Qt::UniqueConnection);
+  if(key.second) {
+    connect(key.second, SIGNAL(geometryChanged(QRect)), this, SLOT(screenChanged()), Qt::UniqueConnection);
+    connect(key.second, SIGNAL(logicalDotsPerInchChanged(qreal)), this, SLOT(screenChanged()), Qt::UniqueConnection);
+    connect(key.second, SIGNAL(physicalDotsPerInchChanged(qreal)), this, SLOT(screenChanged()), Qt::UniqueConnection);
+    connect(key.second, SIGNAL(destroyed(QObject*)), this, SLOT(screenDestroyed(QObject*)), Qt::UniqueConnection);
+  }
+  return transforms.insert(key, QTransform(ex.x(), ex.y(), ey.x(), ey.y(), o.x(), o.y())).value();
+}
+
+// map screenPos -> pos for all points, keeping sub-pixel precision
+void WindowTransformCache::mapFromGlobal(QWindow* window, QList<QTouchEvent::TouchPoint>& points)
+{
+  const QTransform& t = fromGlobal(window);
+  for(int ii = 0; ii < points.count(); ++ii)
+    points[ii].setPos(t.map(points[ii].screenPos()));
+}
+
+// Map is anchored at a sample, so any pixel origin works; per-axis scale starts from the screen's physical
+//  size and is refined from the anchor and a second sample far enough away that pixel rounding doesn't matter
+QPointF WindowTransformCache::mapHimetric(QScreen* screen, const QPoint& him, const QPoint& pix)
+{
+  const qreal MIN_CALIBRATION_DIST = 100;  // pixels
+  QHash<QScreen*, HimetricMap>::iterator it = himetricMaps.find(screen);
+  if(it == himetricMaps.end()) {
+    // initial guess from physical size; on Surface Pro, result is close, but not quite
+    // 1 HIMETRIC = 0.01 mm; this is equiv to GetDeviceCaps(HORZRES)/GetDeviceCaps(HORZSIZE)
+    // scale of 0 means uncalibrated (physical size unknown, e.g., virtual display)
+    HimetricMap m;
+    QSizeF nativesize = QSizeF(screen->geometry().size())*screen->devicePixelRatio();
+    QSizeF physsize = screen->physicalSize();
+    m.sx = physsize.width() > 0 ? nativesize.width()/(100*physsize.width()) : 0;
+    m.sy = physsize.height() > 0 ? nativesize.height()/(100*physsize.height()) : 0;
+    m.anchorHim = him;
+    m.anchorPix = pix;
+    connect(screen, SIGNAL(geometryChanged(QRect)), this, SLOT(screenChanged()), Qt::UniqueConnection);
+    connect(screen, SIGNAL(logicalDotsPerInchChanged(qreal)), this, SLOT(screenChanged()), Qt::UniqueConnection);
+    connect(screen, SIGNAL(physicalDotsPerInchChanged(qreal)), this, SLOT(screenChanged()), Qt::UniqueConnection);
+    connect(screen, SIGNAL(destroyed(QObject*)), this, SLOT(screenDestroyed(QObject*)), Qt::UniqueConnection);
+    it = himetricMaps.insert(screen, m);
+  }
+  HimetricMap& m = it.value();
+  QPointF dhim = QPointF(him) - m.anchorHim;
+  QPointF pos = m.anchorPix + QPointF(dhim.x()*m.sx, dhim.y()*m.sy);
+  if(qAbs(pos.x() - pix.x()) <= 1 && qAbs(pos.y() - pix.y()) <= 1)
+    return pos;
+
+  QPointF dpix = QPointF(pix) - m.anchorPix;
+  if(qAbs(dpix.x()) >= MIN_CALIBRATION_DIST && dhim.x() != 0)
+    m.sx = dpix.x()/dhim.x();
+  if(qAbs(dpix.y()) >= MIN_CALIBRATION_DIST && dhim.y() != 0)
+    m.sy = dpix.y()/dhim.y();
+  pos = m.anchorPix + QPointF(dhim.x()*m.sx, dhim.y()*m.sy);
+  if(qAbs(pos.x() - pix.x()) > 1 || qAbs(pos.y() - pix.y()) > 1) {
+    // too close to anchor to fix scale (or anchor was bad), so move anchor here
+    m.anchorHim = him;
+    m.anchorPix = pix;
+    pos = pix;
+  }
+  return pos;
+}
+
+void WindowTransformCache::invalidateWindow(QWindow* window)
+{
+  QHash<TransformKey, QTransform>::iterator it = transforms.begin();
+  while(it != transforms.end()) {
+    if(it.key().first == window)
+      it = transforms.erase(it);
+    else
+      ++it;
+  }
+}
+
+void WindowTransformCache::invalidateScreen(QScreen* screen)
+{
+  himetricMaps.remove(screen);
+  QHash<TransformKey, QTransform>::iterator it = transforms.begin();
+  while(it != transforms.end()) {
+    if(it.key().second == screen)
+      it = transforms.erase(it);
+    else
+      ++it;
+  }
+}
+
+void WindowTransformCache::windowChanged()
+{
+  invalidateWindow(static_cast<QWindow*>(sender()));
+}
+
+// only the pointer value is used, so it's OK that QWindow part of obj is already destroyed
+void WindowTransformCache::windowDestroyed(QObject* obj)
+{
+  invalidateWindow(static_cast<QWindow*>(obj));
+}
+
+void WindowTransformCache::screenChanged()
+{
+  invalidateScreen(static_cast<QScreen*>(sender()));
+}
+
+void WindowTransformCache::screenDestroyed(QObject* obj)
+{
+  invalidateScreen(static_cast<QScreen*>(obj));
+}
+
 void TouchHelperObject::tabletWindowDestroyed()
 {
   TouchInputFilter::instance()->tabletTarget = NULL;
@@ -428,6 +731,283 @@ void TouchHelperObject::touchWindowDestroyed()
   TouchInputFilter::instance()->touchTarget = NULL;
 }
 
+void TouchHelperObject::pollSharedInput()
+{
+  static_cast<SharedInputFilter*>(TouchInputFilter::instance())->poll();
+}
+
+// Shared memory input broker
+
+#define SHARED_POLL_INTERVAL 4  // msec
+#define SHARED_IDLE_POLL_INTERVAL 32  // max interval when no input is arriving
+#define SHARED_IDLE_TIME 250  // msec without input before we start backing off
+
+// Broker is only supported on Windows: there, the producer can redirect all touch and pen input on the desktop
+//  to itself and find the process owning the window under a point.  Elsewhere we have neither a desktop-wide
+//  input source nor a way to resolve ownership, so create() and SharedInputFilter::attach() fail
+
+#ifdef Q_OS_WIN
+// Process owning the top-level native window at pos (native pixels); this is the process that would have
+//  received the input without the broker.  Hidden windows (incl. our input target) and click-through windows
+//  are skipped by WindowFromPoint
+static qint64 ownerProcessAt(const QPointF& pos)
+{
+  POINT pt = { LONG(pos.x()), LONG(pos.y()) };
+  HWND hwnd = WindowFromPoint(pt);
+  DWORD pid = 0;
+  if(hwnd)
+    GetWindowThreadProcessId(GetAncestor(hwnd, GA_ROOT), &pid);
+  return pid;
+}
+#endif
+
+// input over windows of processes not using the broker is dropped, since it was redirected to us
+static bool isOwnSample(qint64 owner)
+{
+  return owner == QCoreApplication::applicationPid();
+}
+
+TouchInputBroker::TouchInputBroker() : inputTarget(NULL), ring(NULL), writeSeq(0), touchActive(false),
+    tabletActive(false), touchOwner(0), tabletOwner(0) {}
+
+TouchInputBroker::~TouchInputBroker()
+{
+  release();
+}
+
+void TouchInputBroker::release()
+{
+  if(ring)
+    shm.detach();
+  ring = NULL;
+#ifdef Q_OS_WIN
+  if(inputTarget && UnregisterPointerInputTarget) {
+    UnregisterPointerInputTarget(HWND(inputTarget->winId()), PT_TOUCH);
+    UnregisterPointerInputTarget(HWND(inputTarget->winId()), PT_PEN);
+  }
+#endif
+  delete inputTarget;
+  inputTarget = NULL;
+  lockFile.reset();
+}
+
+// fails if another producer is already running with this key, or if we can't get input for the whole desktop
+bool TouchInputBroker::create(const QString& key)
+{
+#ifdef Q_OS_WIN
+  // lock is held for producer's lifetime; QLockFile detects a stale lock left by a crashed producer
+  lockFile.reset(new QLockFile(QDir::temp().absoluteFilePath(key + ".inputbroker.lock")));
+  lockFile->setStaleLockTime(0);
+  if(!lockFile->tryLock(0)) {
+    release();
+    return false;
+  }
+  // WM_POINTER messages only go to the window under the contact, so redirect all touch and pen input to a
+  //  hidden window of ours, where WinInputFilter will see it.  This requires UIAccess (signed executable with
+  //  uiAccess="true" in manifest, installed in a secure location)
+  initWMPointer();
+  inputTarget = new QWindow;
+  inputTarget->create();
+  HWND hwnd = HWND(inputTarget->winId());
+  if(!RegisterPointerInputTarget || !RegisterPointerInputTarget(hwnd, PT_TOUCH)
+      || !RegisterPointerInputTarget(hwnd, PT_PEN)) {
+    release();
+    return false;
+  }
+  shm.setKey(key);
+  // segment can still be attached by consumers of a crashed producer, so take it over
+  if(!shm.create(sizeof(SharedInputRing))
+      && (shm.error() != QSharedMemory::AlreadyExists || !shm.attach())) {
+    release();
+    return false;
+  }
+  if(shm.size() < int(sizeof(SharedInputRing))) {
+    shm.detach();
+    release();
+    return false;
+  }
+  ring = static_cast<SharedInputRing*>(shm.data());
+  writeSeq = sharedRingInit(ring);
+  return true;
+#else
+  Q_UNUSED(key);
+  return false;
+#endif
+}
+
+// owner of a sequence is decided when it starts (mirroring target selection in TouchInputFilter) so the
+//  whole sequence goes to one process; returns true if this process should dispatch the sample
+bool TouchInputBroker::publishTouch(Qt::TouchPointStates touchstate, const QList<QTouchEvent::TouchPoint>& points)
+{
+  if(!ring || points.isEmpty())
+    return true;
+  if(touchstate == Qt::TouchPointPressed && !touchActive) {
+#ifdef Q_OS_WIN
+    touchOwner = ownerProcessAt(points[0].screenPos());
+#endif
+    touchActive = true;
+  }
+  if(touchstate == Qt::TouchPointReleased && points.count() == 1)
+    touchActive = false;
+
+  SharedInputSample* sample = sharedRingBeginWrite(ring, writeSeq);
+  sample->type = QEvent::TouchUpdate;
+  sample->state = int(touchstate);
+  sample->buttons = 0;
+  sample->deviceid = 0;
+  sample->owner = touchOwner;
+  sample->npoints = qMin(points.count(), MAX_SHARED_POINTS);
+  for(int ii = 0; ii < sample->npoints; ++ii) {
+    const QTouchEvent::TouchPoint& pt = points[ii];
+    SharedInputPoint& spt = sample->points[ii];
+    spt.id = pt.id();
+    spt.state = pt.state();
+    spt.x = pt.screenPos().x();
+    spt.y = pt.screenPos().y();
+    spt.width = pt.screenRect().width();
+    spt.height = pt.screenRect().height();
+    spt.pressure = pt.pressure();
+  }
+  sharedRingEndWrite(ring, writeSeq++);
+  return isOwnSample(touchOwner);
+}
+
+bool TouchInputBroker::publishTablet(QEvent::Type eventtype,
+    const QPointF& globalpos, qreal pressure, QTabletEvent::PointerType ptrtype, int buttons, int deviceid)
+{
+  if(!ring)
+    return true;
+  if(eventtype == QEvent::TabletPress || !tabletActive) {
+#ifdef Q_OS_WIN
+    tabletOwner = ownerProcessAt(globalpos);
+#endif
+    tabletActive = true;
+  }
+  if(eventtype == QEvent::TabletRelease)
+    tabletActive = false;
+
+  SharedInputSample* sample = sharedRingBeginWrite(ring, writeSeq);
+  sample->type = eventtype;
+  sample->state = ptrtype;
+  sample->buttons = buttons;
+  sample->deviceid = deviceid;
+  sample->owner = tabletOwner;
+  sample->npoints = 1;
+  SharedInputPoint& spt = sample->points[0];
+  spt.id = deviceid;
+  spt.state = 0;
+  spt.x = globalpos.x();
+  spt.y = globalpos.y();
+  spt.width = 0;
+  spt.height = 0;
+  spt.pressure = pressure;
+  sharedRingEndWrite(ring, writeSeq++);
+  return isOwnSample(tabletOwner);
+}
+
+SharedInputFilter::SharedInputFilter() : attached(false)
+{
+  // palm rejection has already been done by producer
+  palmRejectEnabled = false;
+  pollTimer = new QTimer(helperObject);
+  pollTimer->setTimerType(Qt::PreciseTimer);
+  pollTimer->setInterval(SHARED_POLL_INTERVAL);
+  QObject::connect(pollTimer, SIGNAL(timeout()), helperObject, SLOT(pollSharedInput()));
+}
+
+SharedInputFilter::~SharedInputFilter()
+{
+  if(attached)
+    shm.detach();
+}
+
+// fails if producer hasn't created ring yet, or if broker isn't supported on this platform
+bool SharedInputFilter::attach(const QString& key)
+{
+#ifndef Q_OS_WIN
+  // producer can't resolve which process owns a sample here, so every process would dispatch every sample
+  Q_UNUSED(key);
+  return false;
+#endif
+  shm.setKey(key);
+  if(!shm.attach(QSharedMemory::ReadOnly))
+    return false;
+  const SharedInputRing* ring = static_cast<const SharedInputRing*>(shm.constData());
+  if(shm.size() < int(sizeof(SharedInputRing)) || !sharedRingValid(ring)) {
+    shm.detach();
+    return false;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  // only deliver samples published after we attach
+  reader.attach(ring);
+  attached = true;
+  lastInputTime = inputTimer.elapsed();
+  pollTimer->start();
+  return true;
+}
+
+// Reading the ring is just memory access; the poll timer runs at SHARED_POLL_INTERVAL while input is arriving
+//  or a sequence is active, then backs off to SHARED_IDLE_POLL_INTERVAL, which bounds the latency of the
+//  first sample after idle
+void SharedInputFilter::poll()
+{
+  if(!attached)
+    return;
+  qint64 now = inputTimer.elapsed();
+  if(reader.hasData())
+    lastInputTime = now;
+  SharedInputSample sample;
+  SharedInputReader::Result res;
+  while((res = reader.next(&sample)) != SharedInputReader::Empty) {
+    // samples were lost (overrun or producer restart), possibly including a release, so end any sequence
+    //  in progress rather than leaving touchTarget and TouchApplication's input state stuck
+    if(res == SharedInputReader::Skipped) {
+      cancelInput();
+      continue;
+    }
+    int npoints = qBound(0, int(sample.npoints), MAX_SHARED_POINTS);
+    if(npoints == 0 || !isOwnSample(sample.owner))
+      continue;
+    if(sample.type == QEvent::TouchUpdate) {
+      QList<QTouchEvent::TouchPoint> pts;
+      for(int ii = 0; ii < npoints; ++ii) {
+        const SharedInputPoint& spt = sample.points[ii];
+        QTouchEvent::TouchPoint pt;
+        pt.setId(spt.id);
+        pt.setState(Qt::TouchPointState(spt.state));
+        // setScreenRect also sets screenPos in recent Qt versions, so call it first
+        if(spt.width > 0 && spt.height > 0)
+          pt.setScreenRect(QRectF(spt.x - spt.width/2, spt.y - spt.height/2, spt.width, spt.height));
+        pt.setScreenPos(QPointF(spt.x, spt.y));
+        pt.setPressure(spt.pressure);
+        pts.append(pt);
+      }
+      notifyTouchEvent(Qt::TouchPointStates(sample.state), pts);
+    }
+    else {
+      const SharedInputPoint& spt = sample.points[0];
+      notifyTabletEvent(QEvent::Type(sample.type), QPointF(spt.x, spt.y), spt.pressure,
+          QTabletEvent::PointerType(sample.state), sample.buttons, sample.deviceid);
+    }
+  }
+
+  bool idle = !touchTarget && !tabletTarget && now - lastInputTime > SHARED_IDLE_TIME;
+  int interval = idle ? qMin(2*pollTimer->interval(), SHARED_IDLE_POLL_INTERVAL) : SHARED_POLL_INTERVAL;
+  if(interval != pollTimer->interval())
+    pollTimer->setInterval(interval);
+}
+
+// native messages are left alone: if the producer holds the pointer input target we won't get any pen or
+//  touch messages anyway, and if it doesn't, swallowing them would lose input entirely (incl. promotion to
+//  mouse).  Any native touch or tablet events Qt generates are dropped by TouchApplication::notify()
+bool SharedInputFilter::nativeEventFilter(const QByteArray& eventType, void* message, long* result)
+{
+  Q_UNUSED(eventType);
+  Q_UNUSED(message);
+  Q_UNUSED(result);
+  return false;
+}
+
 
 // see http://code.msdn.microsoft.com/windowsdesktop/Touch-Injection-Sample-444d9bf7/
 /* #ifdef SCRIBBLE_TEST
@@ -3,9 +3,20 @@
 
 #include <QAbstractNativeEventFilter>
 #include <QTabletEvent>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QHash>
+#include <QTransform>
+#include <QSharedMemory>
+#include <QScopedPointer>
+#include "sharedinputring.h"
 
 
 class TouchApplication;
+class TouchInputBroker;
+class QScreen;
+class QTimer;
+class QLockFile;
 
 class TouchHelperObject : public QObject
 {
@@ -14,6 +25,42 @@ class TouchHelperObject : public QObject
 private slots:
   void tabletWindowDestroyed();
   void touchWindowDestroyed();
+  void pollSharedInput();
+};
+
+// Cache of global -> local coordinate transforms keyed by (window, screen), so we don't have to call
+//  QWindow::mapFromGlobal for every point of every sample.  Entries are dropped when the window moves, resizes,
+//  or changes screen, or when the screen's geometry or DPI changes.  Also holds per-screen HIMETRIC to pixel
+//  maps for WM_POINTER pen input, since a single factor is wrong for mixed-DPI multi-monitor setups
+class WindowTransformCache : public QObject
+{
+  Q_OBJECT
+public:
+  WindowTransformCache(QObject* parent = NULL) : QObject(parent) {}
+
+  const QTransform& fromGlobal(QWindow* window);
+  QPointF mapFromGlobal(QWindow* window, const QPointF& globalpos) { return fromGlobal(window).map(globalpos); }
+  void mapFromGlobal(QWindow* window, QList<QTouchEvent::TouchPoint>& points);
+
+  // map HIMETRIC location to native pixels; pix is the (integer) native pixel location of the same sample,
+  //  used to calibrate the map
+  QPointF mapHimetric(QScreen* screen, const QPoint& him, const QPoint& pix);
+
+private slots:
+  void windowChanged();
+  void windowDestroyed(QObject* obj);
+  void screenChanged();
+  void screenDestroyed(QObject* obj);
+
+private:
+  void invalidateWindow(QWindow* window);
+  void invalidateScreen(QScreen* screen);
+
+  typedef QPair<QWindow*, QScreen*> TransformKey;
+  QHash<TransformKey, QTransform> transforms;
+  // pix = anchorPix + (him - anchorHim)*scale, with separate x and y scale
+  struct HimetricMap { QPointF anchorHim; QPointF anchorPix; qreal sx; qreal sy; };
+  QHash<QScreen*, HimetricMap> himetricMaps;
 };
 
 class TouchInputFilter : public QAbstractNativeEventFilter
@@ -24,20 +71,114 @@ public:
   ~TouchInputFilter();
 
   static TouchInputFilter* instance() { return m_instance; }
+  static void setInstance(TouchInputFilter* filter) { m_instance = filter; }
   void notifyTouchEvent(Qt::TouchPointStates touchstate, const QList<QTouchEvent::TouchPoint>& _points);
   void notifyTabletEvent(QEvent::Type eventtype,
       const QPointF& globalpos, qreal pressure, QTabletEvent::PointerType ptrtype, int buttons, int deviceid);
+  // call for any pen activity, incl. hover and entering or leaving proximity
+  void notifyPenProximity();
+
+  // palm rejection (off by default): drop touch points before they reach Qt if pen was seen in the last
+  //  penGuardTime msec, or if contact is too large or part of a cluster of contacts like those produced by
+  //  a resting hand.  Note that this rejects the third finger of a fast three finger gesture
+  bool palmRejection() const { return palmRejectEnabled; }
+  void setPalmRejection(bool enable) { palmRejectEnabled = enable; }
+
+  // if set, all samples passing palm rejection are also published to broker for other processes
+  void setBroker(TouchInputBroker* b) { broker = b; }
+
+  // end any active touch or tablet sequence, e.g., because input for it was lost
+  void cancelInput();
 
 protected:
+  bool rejectContact(const QTouchEvent::TouchPoint& pt, qint64 now);
+  void recordContact(const QTouchEvent::TouchPoint& pt, qint64 now, bool rejected);
+  bool filterRejected(Qt::TouchPointStates& touchstate, QList<QTouchEvent::TouchPoint>& points);
+
   QWindow* tabletTarget;
   QWindow* touchTarget;
   TouchApplication* touchApp;
   QTouchDevice touchDevice;
   TouchHelperObject* helperObject;
+  TouchInputBroker* broker;
+  // last touch points and tablet sample delivered, for cancelInput()
+  QList<QTouchEvent::TouchPoint> lastTouchPoints;
+  QPointF lastTabletPos;
+  QTabletEvent::PointerType lastTabletType;
+  int lastTabletDevice;
+
+  // ring of recent touch presses, newest at nextContact - 1; entries older than the largest time window
+  //  are never examined, so this doubles as our temporal index
+  struct RecentContact { QPointF pos; qint64 time; bool rejected; };
+  enum { MAX_RECENT_CONTACTS = 32 };
+  RecentContact recentContacts[MAX_RECENT_CONTACTS];
+  int nextContact;
+  int numContacts;
+  QSet<int> rejectedIds;
+  QElapsedTimer inputTimer;
+  qint64 penLastSeen;
+  bool palmRejectEnabled;
+  // thresholds in mm (converted to native pixels per screen) and msec
+  qreal maxContactSize;
+  qreal clusterRadius;
+  int clusterCount;
+  int clusterWindow;
+  int palmRegionWindow;
+  int penGuardTime;
 
   static TouchInputFilter* m_instance;
 };
 
+// Shared memory input broker: one process decodes device input and publishes normalized samples (global
+//  screen coords) to a ring in shared memory; other processes attach a SharedInputFilter which reads the ring
+//  and dispatches samples to their own windows, so only one process talks to the input devices.  Each sequence
+//  is tagged with the process owning the window under it at press time, and only that process dispatches it.
+//  Windows only: producer registers as pointer input target for the whole desktop, which requires UIAccess.
+//  See sharedinputring.h for the ring itself
+class TouchInputBroker
+{
+public:
+  TouchInputBroker();
+  ~TouchInputBroker();
+
+  bool create(const QString& key);
+  bool isValid() const { return ring != NULL; }
+  bool publishTouch(Qt::TouchPointStates touchstate, const QList<QTouchEvent::TouchPoint>& points);
+  bool publishTablet(QEvent::Type eventtype,
+      const QPointF& globalpos, qreal pressure, QTabletEvent::PointerType ptrtype, int buttons, int deviceid);
+
+private:
+  void release();
+
+  QSharedMemory shm;
+  QScopedPointer<QLockFile> lockFile;
+  QWindow* inputTarget;
+  SharedInputRing* ring;
+  quint64 writeSeq;
+  bool touchActive;
+  bool tabletActive;
+  qint64 touchOwner;
+  qint64 tabletOwner;
+};
+
+class SharedInputFilter : public TouchInputFilter
+{
+public:
+  SharedInputFilter();
+  ~SharedInputFilter();
+
+  bool attach(const QString& key);
+  void poll();
+  bool nativeEventFilter(const QByteArray& eventType, void* message, long* result);
+
+private:
+  QSharedMemory shm;
+  SharedInputReader reader;
+  bool attached;
+  qint64 lastInputTime;
+  QTimer* pollTimer;
+};
+
 #ifdef Q_OS_WIN
 #include "wintab/wmpointer.h"
 